@@ -14,14 +14,28 @@
 #include <string.h>
 #include <stdio.h>
 
+#include "msd2smf.h"
+
 #define MSD_MAGIC "WMSD"
 #define MSD_HEADER_SIZE 0x14
+#define SMF_HEADER_SIZE (14 + 8)
 #define DEFAULT_TRACK_ALLOC 65536
+#define DEFAULT_TEMPO 500000
+#define TRANSITION_MAGIC "WMST"
+#define TRANSITION_HEADER_SIZE 16
+#define TRANSITION_ENTRY_SIZE 100
 
 static uint32_t read_le32(const uint8_t* p) {
     return p[0] | (p[1] << 8) | (p[2] << 16) | (p[3] << 24);
 }
 
+static void write_le32(uint8_t* p, uint32_t val) {
+    p[0] = (uint8_t)val;
+    p[1] = (uint8_t)(val >> 8);
+    p[2] = (uint8_t)(val >> 16);
+    p[3] = (uint8_t)(val >> 24);
+}
+
 static uint16_t to_be16(const uint16_t val) {
     return (val >> 8) | (val << 8);
 }
@@ -34,14 +48,14 @@ static uint32_t to_be32(const uint32_t val) {
 // Write variable-length quantity
 static int write_vlq(uint32_t value, uint8_t* out) {
     int len = 0;
-    uint8_t buf[4] = {0};
-    buf[3] = value & 0x7F;
+    uint8_t buf[5] = {0};
+    buf[4] = value & 0x7F;
     len = 1;
     while ((value >>= 7)) {
-        buf[3 - len] = 0x80 | (value & 0x7F);
+        buf[4 - len] = 0x80 | (value & 0x7F);
         len++;
     }
-    memcpy(out, &buf[4 - len], len);
+    memcpy(out, &buf[5 - len], len);
     return len;
 }
 
@@ -80,151 +94,500 @@ static int midi_cmd_len(uint8_t status) {
     return len_table[(status >> 4) & 0x7];
 }
 
-int convert_msd_to_smf(const uint8_t* msd, size_t size, uint8_t* out_buff, size_t* out_size, int flag) {
-    if (size < MSD_HEADER_SIZE || memcmp(msd, MSD_MAGIC, 4) != 0) return -1;
+// Track output buffer
+// With an iovec list, large SysEx payloads are referenced in place and
+// only the bytes around them are written to the buffer.
+typedef struct {
+    uint8_t* buff;
+    size_t size;
+    size_t len;
+    struct iovec* iov;
+    int iov_max;
+    int iov_count;
+    size_t mark;        // start of the buffer bytes not yet in the iovec list
+    size_t ref_len;     // total size of the referenced payloads
+    int overflow;
+} track_writer;
+
+// Reserve space for an event, or NULL if the buffer is full
+static uint8_t* track_reserve(track_writer* w, size_t len) {
+    if (w->overflow || w->len + len > w->size) {
+        w->overflow = 1;
+        return NULL;
+    }
+    return w->buff + w->len;
+}
 
-    uint32_t timebase = read_le32(msd + 4);
-    uint32_t packet_count = read_le32(msd + 0x10);
+// Close the pending buffer bytes as an iovec entry
+static void track_flush(track_writer* w) {
+    if (w->len > w->mark) {
+        w->iov[w->iov_count].iov_base = w->buff + w->mark;
+        w->iov[w->iov_count].iov_len = w->len - w->mark;
+        w->iov_count++;
+        w->mark = w->len;
+    }
+}
 
-    const uint8_t* ptr = msd + MSD_HEADER_SIZE;
-    const uint8_t* end = msd + size;
+// Reference data in place (keeps one entry free for the final flush)
+static void track_ref(track_writer* w, const uint8_t* data, size_t len) {
+    if (w->overflow || w->iov_count + 3 > w->iov_max) {
+        w->overflow = 1;
+        return;
+    }
+    track_flush(w);
+    w->iov[w->iov_count].iov_base = (void*)data;
+    w->iov[w->iov_count].iov_len = len;
+    w->iov_count++;
+    w->ref_len += len;
+}
 
-    // The converted size should be at most twice the size.
-    size_t track_alloc = (size * 2 > DEFAULT_TRACK_ALLOC) ? size * 2 : DEFAULT_TRACK_ALLOC;
-    uint8_t* track = (uint8_t*)malloc(track_alloc);
-    if (!track) return -2;
+static void put_meta_event(track_writer* w, uint32_t delta, uint8_t type, const uint8_t* data, uint32_t len) {
+    uint8_t* p = track_reserve(w, 12 + len);
+    if (p) w->len += write_meta_event(p, delta, type, data, len);
+}
 
-    size_t track_len = 0;
-    uint32_t delta_time = 0;
-    int loop_started = 0;
+static void put_short_message(track_writer* w, uint32_t delta, const uint8_t* msg, int len) {
+    uint8_t* p = track_reserve(w, 5 + len);
+    if (p) w->len += write_short_message(p, delta, msg, len);
+}
 
-    uint32_t* nid_list = (uint32_t*)malloc(sizeof(uint32_t) * packet_count);
-    if (!nid_list) { free(track); return -3; }
+static void put_sysex_event(track_writer* w, uint32_t delta, const uint8_t* data, uint32_t len) {
+    if (w->iov && len > SYSEX_REF_MIN) {
+        uint8_t* p = track_reserve(w, 11);
+        if (!p) return;
+        int pos = write_vlq(delta, p);
+        p[pos++] = 0xF0;
+        pos += write_vlq(len - 1, p + pos);
+        w->len += pos;
+        track_ref(w, data + 1, len - 1);
+    } else {
+        uint8_t* p = track_reserve(w, 11 + (size_t)len);
+        if (p) w->len += write_sysex_event(p, delta, data, len);
+    }
+}
 
-    const uint8_t* chk_ptr = ptr;
-    for (uint32_t i = 0; i < packet_count && chk_ptr + 16 <= end; ++i) {
-        uint32_t nid = read_le32(chk_ptr + 4);
+// Write SMF header + track chunk header
+static void write_smf_header(uint8_t* p, uint32_t timebase, size_t track_len) {
+    memcpy(p, "MThd", 4); p += 4;
+    *(uint32_t*)p = to_be32(6); p += 4;
+    *(uint16_t*)p = to_be16(0); p += 2;
+    *(uint16_t*)p = to_be16(1); p += 2;
+    *(uint16_t*)p = to_be16((uint16_t)timebase); p += 2;
+
+    memcpy(p, "MTrk", 4); p += 4;
+    *(uint32_t*)p = to_be32((uint32_t)track_len);
+}
+
+int msd_reader_init(msd_reader* r, const uint8_t* msd, size_t size) {
+    if (size < MSD_HEADER_SIZE || memcmp(msd, MSD_MAGIC, 4) != 0) return -1;
+
+    memset(r, 0, sizeof(*r));
+    r->data = msd;
+    r->end = msd + size;
+    r->next = msd + MSD_HEADER_SIZE;
+    r->timebase = read_le32(msd + 4);
+    r->packet_count = read_le32(msd + 0x10);
+
+    // The loop target is the next ID of the last packet
+    const uint8_t* chk_ptr = r->next;
+    for (uint32_t i = 0; i < r->packet_count && chk_ptr + 16 <= r->end; ++i) {
         uint32_t len = read_le32(chk_ptr + 12);
-        nid_list[i] = nid;
+        if (i == r->packet_count - 1) {
+            r->loop_id = read_le32(chk_ptr + 4);
+            r->has_loop = 1;
+        }
         chk_ptr += 16;
-        if (chk_ptr + len > end) break;
+        if (chk_ptr + len > r->end) break;
         chk_ptr += (len + 3) & ~3;
     }
+    return 0;
+}
+
+int msd_reader_rewind_loop(msd_reader* r) {
+    if (!r->loop_packet) return -1;
+    r->next = r->loop_packet;
+    r->packet_index = r->loop_index;
+    r->payload = NULL;
+    r->len = 0;
+    r->offset = 0;
+    r->delta = 0;
+    return 0;
+}
+
+// Fill an event and reset the pending delta time
+static int reader_emit(msd_reader* r, msd_event* ev, int type, const uint8_t* data, uint32_t len) {
+    ev->type = type;
+    ev->delta = r->delta;
+    ev->data = data;
+    ev->len = len;
+    r->delta = 0;
+    return type != MSD_EVENT_END;
+}
+
+int msd_read_event(msd_reader* r, msd_event* ev) {
+    for (;;) {
+        if (r->offset + 12 > r->len) {
+            // Next packet
+            if (r->packet_index >= r->packet_count || r->next + 16 > r->end) {
+                return reader_emit(r, ev, MSD_EVENT_END, NULL, 0);
+            }
+            const uint8_t* header = r->next;
+            uint32_t pid = read_le32(header);
+            uint32_t len = read_le32(header + 12);
+            if (header + 16 + len > r->end) {
+                r->packet_index = r->packet_count;
+                return reader_emit(r, ev, MSD_EVENT_END, NULL, 0);
+            }
+
+            r->payload = header + 16;
+            r->len = len;
+            r->offset = 0;
+            r->next = r->payload + ((len + 3) & ~3);
+            r->packet_index++;
+
+            if (r->has_loop && pid == r->loop_id && !r->loop_packet) {
+                r->loop_packet = header;
+                r->loop_index = r->packet_index - 1;
+                ev->offset = header - r->data;
+                return reader_emit(r, ev, MSD_EVENT_LOOP_START, NULL, 0);
+            }
+            if (r->report_packets) {
+                // The pending delta time stays with the next event
+                ev->type = MSD_EVENT_PACKET;
+                ev->delta = r->delta;
+                ev->data = NULL;
+                ev->len = 0;
+                ev->offset = header - r->data;
+                return 1;
+            }
+            continue;
+        }
+
+        const uint8_t* e = r->payload + r->offset;
+        uint32_t param = read_le32(e + 8);
+        uint8_t type = e[11] & 0xBF;
+        r->delta += read_le32(e);
+        ev->offset = e - r->data;
+
+        if (type == 0 && e[8] != 0xFF) {
+            int msglen = midi_cmd_len(e[8]);
+            r->offset += 12;
+            if (msglen > 0) return reader_emit(r, ev, MSD_EVENT_SHORT, e + 8, msglen);
+        } else if (type == 1) {
+            r->offset += 12;
+            ev->tempo = e[8] | (e[9] << 8) | (e[10] << 16);
+            return reader_emit(r, ev, MSD_EVENT_TEMPO, e + 8, 3);
+        } else if (type == 0x80) {
+            uint32_t sysex_len = param & 0xFFFFFF;
+            if (sysex_len == 0) {
+                // Empty SysEx: nothing to send, the delta time moves on
+                r->offset += 12;
+            } else if (r->offset + 12 + sysex_len <= r->len) {
+                r->offset += 12 + ((sysex_len + 3) & ~3);
+                return reader_emit(r, ev, MSD_EVENT_SYSEX, e + 12, sysex_len);
+            } else {
+                // Truncated SysEx: the rest of the packet is ignored
+                r->offset = r->len;
+            }
+        } else if (e[11] & 0x80) {
+            uint32_t skip_len = ((param & 0xFFFFFF) + 3) & ~3;
+            r->offset += skip_len ? skip_len : 12;
+        } else {
+            r->offset += 12;
+        }
+    }
+}
 
-    for (uint32_t i = 0; i < packet_count && ptr + 16 <= end; ++i) {
-        uint32_t pid = read_le32(ptr);
-        //uint32_t nid = read_le32(ptr + 4);
-        uint32_t len = read_le32(ptr + 12);
-        ptr += 16;
+// Song state tracked for transition points
+typedef struct {
+    msd_transition* points;
+    size_t max;
+    size_t count;
+    uint64_t tick;
+    uint64_t elapsed;       // microseconds * timebase
+    uint32_t tempo;
+    uint32_t timebase;
+    uint8_t notes[16][128];
+    msd_transition state;
+} transition_state;
+
+// Advance the song position by a delta time
+static void transition_advance(transition_state* t, uint32_t delta) {
+    t->tick += delta;
+    t->elapsed += (uint64_t)delta * t->tempo;
+}
 
-        if (ptr + len > end) break;
+// Record a transition point at the current position
+static void transition_add(transition_state* t, int kind, size_t offset, uint32_t delta) {
+    if (t->count >= t->max) {
+        t->count = t->max + 1;
+        return;
+    }
+    msd_transition* p = &t->points[t->count++];
+    *p = t->state;
+    p->kind = (uint8_t)kind;
+    p->tick = (uint32_t)(t->tick + delta);
+    p->time_us = (t->elapsed + (uint64_t)delta * t->tempo) / (t->timebase ? t->timebase : 1);
+    p->offset = (uint32_t)offset;
+}
 
-        const uint8_t* payload = ptr;
-        ptr += (len + 3) & ~3;
+// Update the note and controller state by a short message
+static void transition_message(transition_state* t, const uint8_t* msg, uint32_t len) {
+    uint8_t ch = msg[0] & 0x0F;
+    uint8_t cmd = msg[0] & 0xF0;
+    msd_transition* s = &t->state;
+
+    if (cmd == 0x90 && len == 3 && msg[2] > 0) {
+        if (t->notes[ch][msg[1] & 0x7F]++ == 0) s->notes[ch]++;
+    } else if ((cmd == 0x80 || cmd == 0x90) && len == 3) {
+        if (t->notes[ch][msg[1] & 0x7F]) {
+            t->notes[ch][msg[1] & 0x7F] = 0;
+            s->notes[ch]--;
+        }
+    } else if (cmd == 0xC0 && len == 2) {
+        s->program[ch] = msg[1];
+    } else if (cmd == 0xB0 && len == 3) {
+        switch (msg[1]) {
+        case 7:  s->volume[ch] = msg[2]; break;
+        case 10: s->pan[ch] = msg[2]; break;
+        case 11: s->expression[ch] = msg[2]; break;
+        case 64:
+            if (msg[2] >= 64) s->sustain |= 1 << ch;
+            else s->sustain &= ~(1 << ch);
+            break;
+        case 120: case 123:
+            // All sound off / all notes off
+            memset(t->notes[ch], 0, sizeof(t->notes[ch]));
+            s->notes[ch] = 0;
+            break;
+        }
+    }
+}
 
-        if (pid == nid_list[packet_count - 1] && !loop_started) {
-            // Loop start marker
+// Convert MSD packets to track events
+// With a transition state, the packet boundaries and the loop edges are recorded.
+static int convert_track(const uint8_t* msd, size_t size, track_writer* w, int flag, transition_state* t) {
+    msd_reader r;
+    msd_event ev;
+    int loop_started = 0;
+
+    if (msd_reader_init(&r, msd, size) != 0) return -1;
+    r.report_packets = t != NULL;
+
+    while (msd_read_event(&r, &ev)) {
+        if (t) {
+            if (ev.type == MSD_EVENT_PACKET || ev.type == MSD_EVENT_LOOP_START) {
+                transition_add(t, ev.type == MSD_EVENT_PACKET ? MSD_TRANSITION_PACKET : MSD_TRANSITION_LOOP_START,
+                               ev.offset, ev.delta);
+                if (ev.type == MSD_EVENT_PACKET) continue;
+            }
+            transition_advance(t, ev.delta);
+            if (ev.type == MSD_EVENT_SHORT) transition_message(t, ev.data, ev.len);
+            if (ev.type == MSD_EVENT_TEMPO) t->tempo = ev.tempo;
+        }
+
+        switch (ev.type) {
+        case MSD_EVENT_LOOP_START:
             if (flag == 0) {
                 // Meta event loopStart
-                uint8_t meta[32];
-                int mlen = write_meta_event(meta, delta_time, 0x06, (const uint8_t*)"loopStart", 9);
-                memcpy(track + track_len, meta, mlen);
-                track_len += mlen;
+                put_meta_event(w, ev.delta, 0x06, (const uint8_t*)"loopStart", 9);
             } else if (flag == 1) {
                 // CC111 event: Bn 6F xx (channel 0, CC#111, value 0)
                 const uint8_t msg[3] = { 0xB0, 0x6F, 0x00 };
-                int mlen = write_short_message(track + track_len, delta_time, msg, 3);
-                track_len += mlen;
+                put_short_message(w, ev.delta, msg, 3);
             }
-            delta_time = 0;
             loop_started = 1;
+            break;
+        case MSD_EVENT_SHORT:
+            put_short_message(w, ev.delta, ev.data, ev.len);
+            break;
+        case MSD_EVENT_TEMPO: {
+            uint8_t tempo[3] = { ev.data[2], ev.data[1], ev.data[0] };
+            put_meta_event(w, ev.delta, 0x51, tempo, 3);
+            break;
+        }
+        case MSD_EVENT_SYSEX:
+            put_sysex_event(w, ev.delta, ev.data, ev.len);
+            break;
         }
+    }
 
-        size_t offset = 0;
-        while (offset + 12 <= len) {
-            const uint8_t* ev = payload + offset;
-            uint32_t delta = read_le32(ev);
-            delta_time += delta;
-            uint32_t param = read_le32(ev + 8);
-            uint8_t type = ev[11] & 0xBF;
-
-            if (type == 0 && ev[8] != 0xFF) {
-                int msglen = midi_cmd_len(ev[8]);
-                if (msglen > 0) {
-                    uint8_t tmp[16] = {0};
-                    int wlen = write_short_message(tmp, delta_time, ev + 8, msglen);
-                    memcpy(track + track_len, tmp, wlen);
-                    track_len += wlen;
-                    delta_time = 0;
-                }
-            } else if (type == 1) {
-                uint8_t tempo[3] = { ev[10], ev[9], ev[8] };
-                uint8_t tmp[16] = {0};
-                int wlen = write_meta_event(tmp, delta_time, 0x51, tempo, 3);
-                memcpy(track + track_len, tmp, wlen);
-                track_len += wlen;
-                delta_time = 0;
-            } else if (type == 0x80) {
-                uint32_t sysex_len = param & 0xFFFFFF;
-                const uint8_t* sysex = payload + offset + 12;
-                if (offset + 12 + sysex_len <= len) {
-                    uint8_t tmp[1024];
-                    int wlen = write_sysex_event(tmp, delta_time, sysex, sysex_len);
-                    memcpy(track + track_len, tmp, wlen);
-                    track_len += wlen;
-                    delta_time = 0;
-                    offset += ((sysex_len + 3) & ~3);
-                } else {
-                    break;
-                }
-            } else if (ev[11] & 0x80) {
-                uint32_t skip_len = param & 0xFFFFFF;
-                offset += ((skip_len + 3) & ~3);
-                continue;
-            }
+    uint32_t delta_time = ev.delta;
 
-            offset += 12;
-        }
+    if (t) {
+        transition_add(t, loop_started ? MSD_TRANSITION_LOOP_END : MSD_TRANSITION_END,
+                       r.next - msd, delta_time);
     }
 
     // Loop end marker
     if (loop_started && flag == 0) {
-        uint8_t tmp[32];
-        int mlen = write_meta_event(tmp, delta_time, 0x06, (const uint8_t*)"loopEnd", 7);
-        memcpy(track + track_len, tmp, mlen);
-        track_len += mlen;
+        put_meta_event(w, delta_time, 0x06, (const uint8_t*)"loopEnd", 7);
         delta_time = 0;
     }
 
     // End of track
-    uint8_t tmp[16];
-    int mlen = write_meta_event(tmp, delta_time, 0x2F, NULL, 0);
-    memcpy(track + track_len, tmp, mlen);
-    track_len += mlen;
+    put_meta_event(w, delta_time, 0x2F, NULL, 0);
 
-    // SMF header + track chunk
-    size_t smf_size = 14 + 8 + track_len;
+    return 0;
+}
+
+// Convert MSD to SMF into a buffer
+static int convert_to_buffer(const uint8_t* msd, size_t size, uint8_t* out_buff, size_t* out_size, int flag,
+                             transition_state* t) {
+    if (size < MSD_HEADER_SIZE || memcmp(msd, MSD_MAGIC, 4) != 0) return -1;
+
+    uint32_t timebase = read_le32(msd + 4);
+
+    // The converted size should be at most twice the size.
+    size_t track_alloc = (size * 2 > DEFAULT_TRACK_ALLOC) ? size * 2 : DEFAULT_TRACK_ALLOC;
+    uint8_t* track = (uint8_t*)malloc(track_alloc);
+    if (!track) return -2;
 
-    if (out_buff == NULL || *out_size < smf_size) {
-        free(nid_list);
+    track_writer w = {0};
+    w.buff = track;
+    w.size = track_alloc;
+
+    int result = convert_track(msd, size, &w, flag, t);
+    if (result != 0) {
         free(track);
-        return -4;  // buffer too small
+        return result;
     }
 
-    uint8_t* p = out_buff;
+    // SMF header + track chunk
+    size_t smf_size = SMF_HEADER_SIZE + w.len;
 
-    memcpy(p, "MThd", 4); p += 4;
-    *(uint32_t*)p = to_be32(6); p += 4;
-    *(uint16_t*)p = to_be16(0); p += 2;
-    *(uint16_t*)p = to_be16(1); p += 2;
-    *(uint16_t*)p = to_be16((uint16_t)timebase); p += 2;
+    if (w.overflow || out_buff == NULL || *out_size < smf_size) {
+        free(track);
+        return -4;  // buffer too small
+    }
 
-    memcpy(p, "MTrk", 4); p += 4;
-    *(uint32_t*)p = to_be32((uint32_t)track_len); p += 4;
-    memcpy(p, track, track_len);
+    write_smf_header(out_buff, timebase, w.len);
+    memcpy(out_buff + SMF_HEADER_SIZE, track, w.len);
 
-    free(nid_list);
     free(track);
     if (out_size) *out_size = smf_size;
     return 0;
 }
+
+int convert_msd_to_smf(const uint8_t* msd, size_t size, uint8_t* out_buff, size_t* out_size, int flag) {
+    return convert_to_buffer(msd, size, out_buff, out_size, flag, NULL);
+}
+
+int convert_msd_to_smf_transitions(const uint8_t* msd, size_t size, uint8_t* out_buff, size_t* out_size, int flag,
+                                   msd_transition* points, size_t* point_count) {
+    if (size < MSD_HEADER_SIZE || memcmp(msd, MSD_MAGIC, 4) != 0) return -1;
+
+    transition_state* t = (transition_state*)calloc(1, sizeof(transition_state));
+    if (!t) return -2;
+    t->points = points;
+    t->max = *point_count;
+    t->tempo = DEFAULT_TEMPO;
+    t->timebase = read_le32(msd + 4);
+    memset(t->state.program, 0xFF, sizeof(t->state.program));
+    memset(t->state.volume, 0xFF, sizeof(t->state.volume));
+    memset(t->state.pan, 0xFF, sizeof(t->state.pan));
+    memset(t->state.expression, 0xFF, sizeof(t->state.expression));
+
+    int result = convert_to_buffer(msd, size, out_buff, out_size, flag, t);
+    if (result == 0 && t->count > t->max) result = -4;  // point list too small
+    if (result == 0) *point_count = t->count;
+
+    free(t);
+    return result;
+}
+
+size_t write_transition_index(const msd_transition* points, size_t point_count, uint32_t timebase,
+                              uint8_t* buff, size_t size) {
+    size_t need = TRANSITION_HEADER_SIZE + point_count * TRANSITION_ENTRY_SIZE;
+    if (buff == NULL || size < need) return need;
+
+    uint8_t* p = buff;
+    memcpy(p, TRANSITION_MAGIC, 4);
+    write_le32(p + 4, timebase);
+    write_le32(p + 8, (uint32_t)point_count);
+    write_le32(p + 12, 0);
+    p += TRANSITION_HEADER_SIZE;
+
+    for (size_t i = 0; i < point_count; ++i) {
+        const msd_transition* pt = &points[i];
+        write_le32(p, (uint32_t)pt->time_us);
+        write_le32(p + 4, (uint32_t)(pt->time_us >> 32));
+        write_le32(p + 8, pt->tick);
+        write_le32(p + 12, pt->offset);
+        p[16] = pt->kind;
+        p[17] = 0;
+        p[18] = (uint8_t)pt->sustain;
+        p[19] = (uint8_t)(pt->sustain >> 8);
+        memcpy(p + 20, pt->notes, 16);
+        memcpy(p + 36, pt->program, 16);
+        memcpy(p + 52, pt->volume, 16);
+        memcpy(p + 68, pt->pan, 16);
+        memcpy(p + 84, pt->expression, 16);
+        p += TRANSITION_ENTRY_SIZE;
+    }
+    return need;
+}
+
+int read_transition_index(const uint8_t* data, size_t size, msd_transition* points, size_t* point_count) {
+    if (size < TRANSITION_HEADER_SIZE || memcmp(data, TRANSITION_MAGIC, 4) != 0) return -1;
+
+    uint32_t count = read_le32(data + 8);
+    if ((size - TRANSITION_HEADER_SIZE) / TRANSITION_ENTRY_SIZE < count) return -1;
+    if (*point_count < count) return -4;
+
+    const uint8_t* p = data + TRANSITION_HEADER_SIZE;
+    for (uint32_t i = 0; i < count; ++i) {
+        msd_transition* pt = &points[i];
+        pt->time_us = read_le32(p) | ((uint64_t)read_le32(p + 4) << 32);
+        pt->tick = read_le32(p + 8);
+        pt->offset = read_le32(p + 12);
+        pt->kind = p[16];
+        pt->sustain = (uint16_t)(p[18] | (p[19] << 8));
+        memcpy(pt->notes, p + 20, 16);
+        memcpy(pt->program, p + 36, 16);
+        memcpy(pt->volume, p + 52, 16);
+        memcpy(pt->pan, p + 68, 16);
+        memcpy(pt->expression, p + 84, 16);
+        p += TRANSITION_ENTRY_SIZE;
+    }
+    *point_count = count;
+    return 0;
+}
+
+size_t find_transition(const msd_transition* points, size_t point_count, uint64_t time_us) {
+    size_t lo = 0;
+    size_t hi = point_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (points[mid].time_us < time_us) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+int convert_msd_to_smf_iov(const uint8_t* msd, size_t size, uint8_t* buff, size_t* buff_size,
+                           struct iovec* iov, int* iov_count, int flag) {
+    if (size < MSD_HEADER_SIZE || memcmp(msd, MSD_MAGIC, 4) != 0) return -1;
+    if (buff == NULL || *buff_size < SMF_HEADER_SIZE || iov == NULL || *iov_count < 1) return -4;
+
+    uint32_t timebase = read_le32(msd + 4);
+
+    // The SMF header is filled in once the track length is known.
+    track_writer w = {0};
+    w.buff = buff;
+    w.size = *buff_size;
+    w.len = SMF_HEADER_SIZE;
+    w.iov = iov;
+    w.iov_max = *iov_count;
+
+    int result = convert_track(msd, size, &w, flag, NULL);
+    if (result != 0) return result;
+    if (w.overflow) return -4;  // buffer or iovec list too small
+
+    track_flush(&w);
+    write_smf_header(buff, timebase, w.len - SMF_HEADER_SIZE + w.ref_len);
+
+    *buff_size = w.len;
+    *iov_count = w.iov_count;
+    return 0;
+}
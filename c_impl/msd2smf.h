@@ -11,6 +11,83 @@
 #define MDS_TO_SMF_H_
 #pragma once
 
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+struct iovec {
+    void* iov_base;
+    size_t iov_len;
+};
+#else
+#include <sys/uio.h>
+#endif
+
+// SysEx payloads longer than this are referenced in place by convert_msd_to_smf_iov
+#define SYSEX_REF_MIN 64
+
+// MSD event types returned by msd_read_event
+enum {
+    MSD_EVENT_END = 0,      // End of data (delta: time after the last event)
+    MSD_EVENT_SHORT,        // Short MIDI message (data/len: message bytes)
+    MSD_EVENT_TEMPO,        // Tempo change (tempo: microseconds per quarter note)
+    MSD_EVENT_SYSEX,        // SysEx message (data/len: message including F0)
+    MSD_EVENT_LOOP_START,   // Start of the loop target packet
+    MSD_EVENT_PACKET,       // Start of another packet (only with report_packets;
+                            // delta is also counted in the next event)
+};
+
+typedef struct {
+    int type;               // MSD_EVENT_*
+    uint32_t delta;         // Ticks since the previous event
+    const uint8_t* data;    // Pointer into the MSD data
+    uint32_t len;
+    uint32_t tempo;
+    size_t offset;          // Offset of the event (or packet) in the MSD data
+} msd_event;
+
+// MSD event reader
+// Skip blocks and no-op events are consumed internally; their delta times are
+// added to the next returned event.
+typedef struct {
+    const uint8_t* data;
+    const uint8_t* end;
+    const uint8_t* next;        // next packet header
+    const uint8_t* payload;     // current packet payload
+    uint32_t len;
+    size_t offset;              // offset in the current payload
+    uint32_t timebase;
+    uint32_t packet_count;
+    uint32_t packet_index;      // index of the next packet
+    uint32_t loop_id;
+    int has_loop;
+    const uint8_t* loop_packet; // loop target header, once reached
+    uint32_t loop_index;
+    uint32_t delta;             // pending delta time
+    int report_packets;         // 1:return MSD_EVENT_PACKET at packet boundaries
+} msd_reader;
+
+// Initialize an MSD event reader
+//
+// @param [out] reader Reader to initialize
+// @param [in] msd_data Pointer of MSD data (must stay valid while reading)
+// @param [in] msd_size MSD data size
+// @return 0:success / other:fail
+int msd_reader_init(msd_reader* reader, const uint8_t* msd_data, size_t msd_size);
+
+// Read the next event
+//
+// @param [in/out] reader Reader
+// @param [out] event Read event
+// @return 1:event read / 0:end of data (event->type is MSD_EVENT_END)
+int msd_read_event(msd_reader* reader, msd_event* event);
+
+// Move the reader back to the loop target packet
+//
+// @param [in/out] reader Reader that has returned MSD_EVENT_LOOP_START
+// @return 0:success / other:no loop
+int msd_reader_rewind_loop(msd_reader* reader);
+
 // Convert MSD to SMF
 //
 // @param [in] msd_data Pointer of MSD data
@@ -21,4 +98,85 @@
 // @return 0:success / other:fail
 int convert_msd_to_smf(const uint8_t* msd_data, size_t msd_size, uint8_t* smf_buff, size_t* smf_size, int flag);
 
+// Convert MSD to SMF as a scatter-gather list
+//
+// The SMF is described by iov[0..iov_count) and can be written with writev/pwritev.
+// Headers, delta times and short messages are encoded into smf_buff, while large
+// SysEx payloads point directly into msd_data, which must stay valid until written.
+//
+// @param [in] msd_data Pointer of MSD data
+// @param [in] msd_size MSD data size
+// @param [in] smf_buff Pointer of buffer for the encoded segments
+// @param [in/out] smf_size in:buffer size / out:used buffer size
+// @param [out] iov Pointer of iovec list
+// @param [in/out] iov_count in:iovec list size / out:used iovec entries
+// @param [in] flag Loop format 0:Meta event (like FF7 PC) / 1:CC111 (like RPG Maker)
+// @return 0:success / other:fail
+int convert_msd_to_smf_iov(const uint8_t* msd_data, size_t msd_size, uint8_t* smf_buff, size_t* smf_size,
+                           struct iovec* iov, int* iov_count, int flag);
+
+// Transition point kinds
+enum {
+    MSD_TRANSITION_PACKET = 0,      // Packet boundary
+    MSD_TRANSITION_LOOP_START,      // Start of the loop target packet
+    MSD_TRANSITION_LOOP_END,        // End of a looping song
+    MSD_TRANSITION_END,             // End of a non-looping song
+};
+
+// Musically safe switching point with the song state at that point
+// Unset program/controller values are 0xFF.
+typedef struct {
+    uint64_t time_us;       // Time from the song start in microseconds
+    uint32_t tick;
+    uint32_t offset;        // Offset of the packet in the MSD data
+    uint8_t kind;           // MSD_TRANSITION_*
+    uint16_t sustain;       // Channels with the sustain pedal down (bit 0 = channel 1)
+    uint8_t notes[16];      // Sounding notes per channel
+    uint8_t program[16];
+    uint8_t volume[16];     // CC#7
+    uint8_t pan[16];        // CC#10
+    uint8_t expression[16]; // CC#11
+} msd_transition;
+
+// Convert MSD to SMF and collect the transition points in the same pass
+//
+// @param [in] msd_data Pointer of MSD data
+// @param [in] msd_size MSD data size
+// @param [in] smf_data Pointer of output buffer
+// @param [in/out] smf_size in:output buffer size / out:write data size
+// @param [in] flag Loop format 0:Meta event (like FF7 PC) / 1:CC111 (like RPG Maker)
+// @param [out] points Pointer of transition point list (packet count + 2 entries is enough)
+// @param [in/out] point_count in:list size / out:number of points
+// @return 0:success / other:fail
+int convert_msd_to_smf_transitions(const uint8_t* msd_data, size_t msd_size, uint8_t* smf_buff, size_t* smf_size,
+                                   int flag, msd_transition* points, size_t* point_count);
+
+// Write transition points as a sidecar index ("WMST")
+//
+// @param [in] points Pointer of transition point list
+// @param [in] point_count Number of points
+// @param [in] timebase Timebase of the song
+// @param [out] buff Pointer of output buffer (NULL to query the size)
+// @param [in] size Output buffer size
+// @return index size (nothing is written if it is larger than size)
+size_t write_transition_index(const msd_transition* points, size_t point_count, uint32_t timebase,
+                              uint8_t* buff, size_t size);
+
+// Read a sidecar index written by write_transition_index
+//
+// @param [in] data Pointer of index data
+// @param [in] size Index data size
+// @param [out] points Pointer of transition point list
+// @param [in/out] point_count in:list size / out:number of points
+// @return 0:success / other:fail
+int read_transition_index(const uint8_t* data, size_t size, msd_transition* points, size_t* point_count);
+
+// Find the first transition point at or after a time (binary search)
+//
+// @param [in] points Pointer of transition point list
+// @param [in] point_count Number of points
+// @param [in] time_us Time from the song start in microseconds
+// @return index of the point / point_count:no point left
+size_t find_transition(const msd_transition* points, size_t point_count, uint64_t time_us);
+
 #endif
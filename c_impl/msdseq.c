@@ -0,0 +1,375 @@
+/*
+ * msdseq.c - Play several MSD songs at once on one timer thread
+ * Copyright (C) 2025  Ru^3
+ *
+ * Every stream decodes its MSD data with msd_reader and keeps the time of its
+ * next event. The streams are kept in a min-heap ordered by that time, so a
+ * single thread sleeps until the earliest event, sends every event that is
+ * due and sleeps again, however many streams are playing.
+ * This file is licensed under the MIT License.
+ */
+
+// clock_gettime and CLOCK_MONOTONIC are hidden in strict ISO C modes
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+#include "msd2smf.h"
+#include "msdseq.h"
+
+#define DEFAULT_TEMPO 500000
+#define MAX_WAIT_US 100000      // a wall-clock step delays an event at most this long
+
+typedef struct {
+    int id;
+    uint8_t* data;
+    msd_reader reader;
+    msd_event event;            // next event to send
+    int loop;
+    uint32_t tempo;
+    uint64_t start_us;
+    uint64_t elapsed;           // song time in microseconds * timebase
+    uint64_t loop_elapsed;      // song time at the last loop rewind
+    uint64_t deadline;          // time of the next event in microseconds
+    uint8_t channel_map[16];
+    int volume;
+    uint8_t notes[16][16];      // sounding notes per output channel
+} stream;
+
+struct msdseq {
+    msdseq_output output;
+    void* user;
+    mtx_t lock;
+    cnd_t wake;
+    thrd_t thread;
+    int running;
+    int next_id;
+    stream** heap;              // min-heap by deadline
+    int count;
+    int capacity;
+};
+
+// Current time of the song clock
+// Monotonic where available, so clock steps do not move the streams.
+static uint64_t now_us(void) {
+    struct timespec ts;
+#if defined(TIME_MONOTONIC)
+    timespec_get(&ts, TIME_MONOTONIC);
+#elif defined(CLOCK_MONOTONIC)
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Wait until woken or for a while, at most until the given song clock time
+// cnd_timedwait takes a TIME_UTC deadline, so the wait is converted and kept
+// short enough that a wall-clock step cannot stall the streams.
+static void wait_until(msdseq* seq, uint64_t deadline, uint64_t now) {
+    uint64_t wait = deadline - now;
+    if (wait > MAX_WAIT_US) wait = MAX_WAIT_US;
+
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    uint64_t nsec = (uint64_t)ts.tv_nsec + wait * 1000;
+    ts.tv_sec += (time_t)(nsec / 1000000000);
+    ts.tv_nsec = (long)(nsec % 1000000000);
+    cnd_timedwait(&seq->wake, &seq->lock, &ts);
+}
+
+static int stream_before(const stream* a, const stream* b) {
+    return a->deadline < b->deadline;
+}
+
+static void heap_swap(msdseq* seq, int a, int b) {
+    stream* tmp = seq->heap[a];
+    seq->heap[a] = seq->heap[b];
+    seq->heap[b] = tmp;
+}
+
+static void heap_up(msdseq* seq, int i) {
+    while (i > 0 && stream_before(seq->heap[i], seq->heap[(i - 1) / 2])) {
+        heap_swap(seq, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(msdseq* seq, int i) {
+    for (;;) {
+        int min = i;
+        int l = i * 2 + 1;
+        int r = l + 1;
+        if (l < seq->count && stream_before(seq->heap[l], seq->heap[min])) min = l;
+        if (r < seq->count && stream_before(seq->heap[r], seq->heap[min])) min = r;
+        if (min == i) return;
+        heap_swap(seq, i, min);
+        i = min;
+    }
+}
+
+static void heap_remove(msdseq* seq, int i) {
+    seq->heap[i] = seq->heap[--seq->count];
+    if (i < seq->count) {
+        heap_up(seq, i);
+        heap_down(seq, i);
+    }
+}
+
+static int heap_find(msdseq* seq, int id) {
+    for (int i = 0; i < seq->count; ++i) {
+        if (seq->heap[i]->id == id) return i;
+    }
+    return -1;
+}
+
+// Read the next event to send, following the loop
+// @return 1:event read / 0:end of song
+static int stream_next(stream* s) {
+    for (;;) {
+        int more = msd_read_event(&s->reader, &s->event);
+        s->elapsed += (uint64_t)s->event.delta * s->tempo;
+
+        if (more) {
+            if (s->event.type == MSD_EVENT_LOOP_START) continue;
+            s->deadline = s->start_us + s->elapsed / s->reader.timebase;
+            return 1;
+        }
+
+        // A loop pass that takes no time would never advance
+        if (!s->loop || s->elapsed == s->loop_elapsed || msd_reader_rewind_loop(&s->reader) != 0) return 0;
+        s->loop_elapsed = s->elapsed;
+    }
+}
+
+// Send note-offs for every sounding note of a stream
+static void stream_release(msdseq* seq, stream* s) {
+    for (int ch = 0; ch < 16; ++ch) {
+        for (int note = 0; note < 128; ++note) {
+            if (s->notes[ch][note >> 3] & (1 << (note & 7))) {
+                const uint8_t msg[3] = { (uint8_t)(0x80 | ch), (uint8_t)note, 0 };
+                seq->output(seq->user, msg, 3);
+            }
+        }
+    }
+    memset(s->notes, 0, sizeof(s->notes));
+}
+
+static void stream_free(stream* s) {
+    free(s->data);
+    free(s);
+}
+
+// Send the pending event of a stream
+static void stream_send(msdseq* seq, stream* s) {
+    const msd_event* ev = &s->event;
+
+    if (ev->type == MSD_EVENT_TEMPO) {
+        s->tempo = ev->tempo;
+        return;
+    }
+    if (ev->type == MSD_EVENT_SYSEX) {
+        seq->output(seq->user, ev->data, ev->len);
+        return;
+    }
+
+    uint8_t msg[3];
+    memcpy(msg, ev->data, ev->len);
+
+    if (msg[0] >= 0x80 && msg[0] < 0xF0) {
+        uint8_t ch = s->channel_map[msg[0] & 0x0F] & 0x0F;
+        uint8_t cmd = msg[0] & 0xF0;
+        msg[0] = cmd | ch;
+        // Data bytes come from the file; keep them in MIDI range
+        for (size_t i = 1; i < ev->len; ++i) msg[i] &= 0x7F;
+
+        if (cmd == 0x90 && msg[2] > 0) {
+            int velocity = msg[2] * s->volume / MSDSEQ_VOLUME_MAX;
+            if (velocity == 0) return;
+            msg[2] = (uint8_t)velocity;
+            s->notes[ch][msg[1] >> 3] |= 1 << (msg[1] & 7);
+        } else if (cmd == 0x80 || cmd == 0x90) {
+            s->notes[ch][msg[1] >> 3] &= ~(1 << (msg[1] & 7));
+        }
+    }
+
+    seq->output(seq->user, msg, ev->len);
+}
+
+static int sequencer_thread(void* arg) {
+    msdseq* seq = (msdseq*)arg;
+
+    mtx_lock(&seq->lock);
+    while (seq->running) {
+        if (seq->count == 0) {
+            cnd_wait(&seq->wake, &seq->lock);
+            continue;
+        }
+
+        stream* s = seq->heap[0];
+        uint64_t now = now_us();
+        if (s->deadline > now) {
+            wait_until(seq, s->deadline, now);
+            continue;
+        }
+
+        stream_send(seq, s);
+        if (stream_next(s)) {
+            heap_down(seq, 0);
+        } else {
+            stream_release(seq, s);
+            heap_remove(seq, 0);
+            stream_free(s);
+        }
+    }
+    mtx_unlock(&seq->lock);
+    return 0;
+}
+
+msdseq* msdseq_create(msdseq_output output, void* user) {
+    msdseq* seq = (msdseq*)calloc(1, sizeof(msdseq));
+    if (!seq) return NULL;
+
+    seq->output = output;
+    seq->user = user;
+    seq->running = 1;
+    seq->next_id = 1;
+
+    if (mtx_init(&seq->lock, mtx_plain) != thrd_success) {
+        free(seq);
+        return NULL;
+    }
+    if (cnd_init(&seq->wake) != thrd_success) {
+        mtx_destroy(&seq->lock);
+        free(seq);
+        return NULL;
+    }
+    if (thrd_create(&seq->thread, sequencer_thread, seq) != thrd_success) {
+        cnd_destroy(&seq->wake);
+        mtx_destroy(&seq->lock);
+        free(seq);
+        return NULL;
+    }
+    return seq;
+}
+
+void msdseq_destroy(msdseq* seq) {
+    if (!seq) return;
+
+    mtx_lock(&seq->lock);
+    seq->running = 0;
+    cnd_signal(&seq->wake);
+    mtx_unlock(&seq->lock);
+    thrd_join(seq->thread, NULL);
+
+    for (int i = 0; i < seq->count; ++i) {
+        stream_release(seq, seq->heap[i]);
+        stream_free(seq->heap[i]);
+    }
+    free(seq->heap);
+    cnd_destroy(&seq->wake);
+    mtx_destroy(&seq->lock);
+    free(seq);
+}
+
+int msdseq_play(msdseq* seq, const uint8_t* msd_data, size_t msd_size, int loop) {
+    stream* s = (stream*)calloc(1, sizeof(stream));
+    if (!s) return -2;
+    s->data = (uint8_t*)malloc(msd_size);
+    if (!s->data) {
+        free(s);
+        return -2;
+    }
+    memcpy(s->data, msd_data, msd_size);
+
+    if (msd_reader_init(&s->reader, s->data, msd_size) != 0 || s->reader.timebase == 0) {
+        stream_free(s);
+        return -1;
+    }
+
+    s->loop = loop;
+    s->tempo = DEFAULT_TEMPO;
+    s->loop_elapsed = UINT64_MAX;
+    s->volume = MSDSEQ_VOLUME_MAX;
+    for (int ch = 0; ch < 16; ++ch) s->channel_map[ch] = (uint8_t)ch;
+
+    mtx_lock(&seq->lock);
+
+    if (seq->count == seq->capacity) {
+        int capacity = seq->capacity ? seq->capacity * 2 : 8;
+        stream** heap = (stream**)realloc(seq->heap, sizeof(stream*) * capacity);
+        if (!heap) {
+            mtx_unlock(&seq->lock);
+            stream_free(s);
+            return -2;
+        }
+        seq->heap = heap;
+        seq->capacity = capacity;
+    }
+
+    s->start_us = now_us();
+    if (!stream_next(s)) {
+        // Nothing to play
+        mtx_unlock(&seq->lock);
+        stream_free(s);
+        return -3;
+    }
+
+    s->id = seq->next_id++;
+    seq->heap[seq->count++] = s;
+    heap_up(seq, seq->count - 1);
+    cnd_signal(&seq->wake);
+
+    mtx_unlock(&seq->lock);
+    return s->id;
+}
+
+int msdseq_stop(msdseq* seq, int id) {
+    mtx_lock(&seq->lock);
+    int i = heap_find(seq, id);
+    if (i >= 0) {
+        stream* s = seq->heap[i];
+        stream_release(seq, s);
+        heap_remove(seq, i);
+        stream_free(s);
+        cnd_signal(&seq->wake);
+    }
+    mtx_unlock(&seq->lock);
+    return i >= 0 ? 0 : -1;
+}
+
+int msdseq_set_channel_map(msdseq* seq, int id, const uint8_t map[16]) {
+    mtx_lock(&seq->lock);
+    int i = heap_find(seq, id);
+    if (i >= 0) {
+        // Sounding notes would not get their note-off on the new channel
+        stream_release(seq, seq->heap[i]);
+        memcpy(seq->heap[i]->channel_map, map, 16);
+    }
+    mtx_unlock(&seq->lock);
+    return i >= 0 ? 0 : -1;
+}
+
+int msdseq_set_volume(msdseq* seq, int id, int volume) {
+    if (volume < 0) volume = 0;
+    if (volume > MSDSEQ_VOLUME_MAX) volume = MSDSEQ_VOLUME_MAX;
+
+    mtx_lock(&seq->lock);
+    int i = heap_find(seq, id);
+    if (i >= 0) seq->heap[i]->volume = volume;
+    mtx_unlock(&seq->lock);
+    return i >= 0 ? 0 : -1;
+}
+
+int msdseq_is_playing(msdseq* seq, int id) {
+    mtx_lock(&seq->lock);
+    int i = heap_find(seq, id);
+    mtx_unlock(&seq->lock);
+    return i >= 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * msdseq.h - Play several MSD songs at once on one timer thread
+ * Copyright (C) 2025  Ru^3
+ *
+ * This file is licensed under the MIT License.
+ */
+#ifndef MSD_SEQ_H_
+#define MSD_SEQ_H_
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MSDSEQ_VOLUME_MAX 128
+
+typedef struct msdseq msdseq;
+
+// MIDI output callback
+// Called from the timer thread; it must not call back into the sequencer.
+//
+// @param [in] user User pointer given to msdseq_create
+// @param [in] msg MIDI message (short message or SysEx including F0)
+// @param [in] len Message length
+typedef void (*msdseq_output)(void* user, const uint8_t* msg, size_t len);
+
+// Create a sequencer and start its timer thread
+// Event times follow a monotonic clock where the platform has one
+// (TIME_MONOTONIC or POSIX CLOCK_MONOTONIC); otherwise they follow the
+// wall clock, and a clock step shifts every playing stream by the step.
+//
+// @param [in] output MIDI output callback
+// @param [in] user User pointer passed to the callback
+// @return sequencer / NULL:fail
+msdseq* msdseq_create(msdseq_output output, void* user);
+
+// Stop all streams and the timer thread, and free the sequencer
+//
+// @param [in] seq Sequencer
+void msdseq_destroy(msdseq* seq);
+
+// Start playing an MSD song
+//
+// @param [in] seq Sequencer
+// @param [in] msd_data Pointer of MSD data (copied)
+// @param [in] msd_size MSD data size
+// @param [in] loop 1:repeat from the loop target (the next ID of the last packet) / 0:play once
+// @return stream ID (> 0) / other:fail
+int msdseq_play(msdseq* seq, const uint8_t* msd_data, size_t msd_size, int loop);
+
+// Stop a stream and release its sounding notes
+//
+// @param [in] seq Sequencer
+// @param [in] id Stream ID
+// @return 0:success / other:no such stream
+int msdseq_stop(msdseq* seq, int id);
+
+// Set the channel map of a stream
+//
+// @param [in] seq Sequencer
+// @param [in] id Stream ID
+// @param [in] map Output channel (0-15) for each song channel
+// @return 0:success / other:no such stream
+int msdseq_set_channel_map(msdseq* seq, int id, const uint8_t map[16]);
+
+// Set the volume of a stream
+// Note-on velocities are scaled, so streams sharing a channel do not
+// override each other's channel volume.
+//
+// @param [in] seq Sequencer
+// @param [in] id Stream ID
+// @param [in] volume 0 - MSDSEQ_VOLUME_MAX (unchanged)
+// @return 0:success / other:no such stream
+int msdseq_set_volume(msdseq* seq, int id, int volume);
+
+// Check whether a stream is still playing
+//
+// @param [in] seq Sequencer
+// @param [in] id Stream ID
+// @return 1:playing / 0:finished or stopped
+int msdseq_is_playing(msdseq* seq, int id);
+
+#endif
@@ -30,7 +30,17 @@ int main(int argc, char* argv[]) {
 
     size_t outSize = size*2;
     uint8_t* outBuff = (uint8_t*)malloc(outSize);
-    int result = convert_msd_to_smf(src, size, outBuff, &outSize, 0);
+    // One point per packet at most, plus the loop start and end
+    size_t pointCount = (size >= 0x14 ? (src[0x10] | src[0x11] << 8 | src[0x12] << 16 | (size_t)src[0x13] << 24) : 0);
+    size_t maxPoints = size >= 0x14 ? (size - 0x14) / 16 : 0;
+    if (pointCount > maxPoints) pointCount = maxPoints;
+    pointCount += 2;
+    msd_transition* points = (msd_transition*)malloc(sizeof(msd_transition) * pointCount);
+    if(NULL == outBuff || NULL == points){
+	printf("malloc error\n");
+	return -1;
+    }
+    int result = convert_msd_to_smf_transitions(src, size, outBuff, &outSize, 0, points, &pointCount);
     if (result != 0) {
 	printf("convert error\n");
 	return -1;
@@ -44,5 +54,26 @@ int main(int argc, char* argv[]) {
     fwrite(outBuff, outSize, 1, wfp);
     fclose(wfp);
 
+    // Transition point sidecar
+    size_t indexSize = write_transition_index(points, pointCount, src[4] | src[5] << 8, NULL, 0);
+    uint8_t* indexBuff = (uint8_t*)malloc(indexSize);
+    if(NULL == indexBuff){
+	printf("malloc error\n");
+	return -1;
+    }
+    write_transition_index(points, pointCount, src[4] | src[5] << 8, indexBuff, indexSize);
+
+    wfp = fopen("converted.mst", "wb");
+    if(NULL == wfp){
+	printf("open write file error\n");
+	return -1;
+    }
+    fwrite(indexBuff, indexSize, 1, wfp);
+    fclose(wfp);
+
+    free(indexBuff);
+    free(points);
+    free(outBuff);
+    free(src);
     return 0;
 }
@@ -64,52 +64,74 @@ def to_smf(tracks, timebase):
 # Lookup table for MIDI message lengths based on the high nibble of the status byte
 cmd_len_tbl = [3, 3, 2, 3, 2, 2, 3, 0]
 
-def conv_mes_safe(data, initial_deltatime=0):
-    # Safely convert a series of MSD-formatted messages to MIDI events.
-    events = []
+def decode_msd_events(data):
+    # Decode a packet payload into (offset, deltatime, kind, record, body) tuples.
+    # kind is one of 'short', 'tempo', 'sysex', 'skip' or 'nop'; record is the
+    # raw 12-byte event and body the decoded message, tempo or attached data.
+    # A SysEx event whose data runs past the payload has a body of None.
     offset = 0
-    deltatime = initial_deltatime
 
     while offset + 12 <= len(data):
+        start = offset
         chunk = data[offset:offset+12]
         offset += 12
         dtime, _, param = struct.unpack("<III", chunk)
-        deltatime += dtime
 
         event_type = chunk[11] & 0xBF
 
         if event_type == 0 and chunk[8] != 0xFF:
             cmd = chunk[8]
             length = cmd_len_tbl[(cmd >> 4) & 7]
-            msg = chunk[8:8+length]
-            events.append(to_smf_shortmes(msg, deltatime))
-            deltatime = 0
+            yield start, dtime, 'short', chunk, chunk[8:8+length]
 
         elif event_type == 1:
             # Tempo change event (Meta 0x51)
             tempo = bytes([chunk[10], chunk[9], chunk[8]])
-            events.append(to_smf_metaevent(0x51, tempo, deltatime))
-            deltatime = 0
+            yield start, dtime, 'tempo', chunk, tempo
 
         elif event_type == 0x80:
             # SysEx event
             sysex_len = param & 0xFFFFFF
             if offset + sysex_len <= len(data):
-                sysex_data = data[offset:offset+sysex_len]
-                events.append(to_smf_sysex(sysex_data, deltatime))
+                yield start, dtime, 'sysex', chunk, data[offset:offset+sysex_len]
                 offset += (sysex_len + 3) & ~3
-            deltatime = 0
+            else:
+                yield start, dtime, 'sysex', chunk, None
+
+        elif chunk[11] & 0x80:
+            # Skip over unknown or unused data block
+            skip_len = param & 0xFFFFFF
+            yield start, dtime, 'skip', chunk, data[offset:offset+skip_len]
+            offset += (skip_len + 3) & ~3
 
         else:
-            if chunk[11] & 0x80:
-                # Skip over unknown or unused data block
-                skip_len = param & 0xFFFFFF
-                offset += (skip_len + 3) & ~3
+            yield start, dtime, 'nop', chunk, None
+
+def conv_mes_safe(data, initial_deltatime=0):
+    # Safely convert a series of MSD-formatted messages to MIDI events.
+    events = []
+    deltatime = initial_deltatime
+
+    for _, dtime, kind, _, body in decode_msd_events(data):
+        deltatime += dtime
+
+        if kind == 'short':
+            events.append(to_smf_shortmes(body, deltatime))
+            deltatime = 0
+
+        elif kind == 'tempo':
+            events.append(to_smf_metaevent(0x51, body, deltatime))
+            deltatime = 0
+
+        elif kind == 'sysex':
+            if body is not None:
+                events.append(to_smf_sysex(body, deltatime))
+            deltatime = 0
 
     return b''.join(events), deltatime
 
-def convert_msd_to_midi(msd_bytes):
-    # Entry point to convert MSD binary data to a MIDI byte stream.
+def parse_msd(msd_bytes):
+    # Split MSD binary data into its timebase and packet list.
     if msd_bytes[:4] != b"WMSD":
         raise ValueError("Invalid MSD header")
 
@@ -119,12 +141,33 @@ def convert_msd_to_midi(msd_bytes):
     offset = 0x14
     packets = []
     for _ in range(packet_count):
-        pid, nid, _, length = struct.unpack_from("<IIII", msd_bytes, offset)
+        pid, nid, param, length = struct.unpack_from("<IIII", msd_bytes, offset)
         offset += 16
         payload = msd_bytes[offset:offset+length]
-        packets.append({"This ID": pid, "Next ID": nid, "Length": length, "Payload": payload})
+        packets.append({"This ID": pid, "Next ID": nid, "Param": param, "Length": length,
+                        "Offset": offset, "Payload": payload})
         offset += (length + 3) & ~3
 
+    return timebase, packets
+
+def split_loop(packets):
+    # Split the packet list into the packets before the loop target and the looped packets.
+    if not packets:
+        return [], None
+
+    loop_id = packets[-1]["Next ID"]
+    for i, pkt in enumerate(packets):
+        if pkt["This ID"] == loop_id:
+            if any(p["This ID"] == loop_id for p in packets[i+1:]):
+                raise ValueError("Duplicate loop target ID")
+            return packets[:i], packets[i:]
+
+    return packets, None
+
+def convert_msd_to_midi(msd_bytes):
+    # Entry point to convert MSD binary data to a MIDI byte stream.
+    timebase, packets = parse_msd(msd_bytes)
+
     track_data = []
     deltatime = 0
     loop = False
@@ -155,10 +198,24 @@ def convert_msd_to_midi(msd_bytes):
 def main():
     # Entry point for command-line usage
     if len(sys.argv) < 2:
-        print("usage: msd2smf [path]")
+        print("usage: msd2smf [path or s3://bucket/prefix] [jobs] [commit interval]")
         return
 
     base_path = sys.argv[1]
+    if base_path.startswith("s3://"):
+        from msds3 import convert_s3, DEFAULT_JOBS
+        jobs = int(sys.argv[2]) if len(sys.argv) > 2 else DEFAULT_JOBS
+        found = False
+        for i, (key, midi_key, error) in enumerate(convert_s3(base_path, convert_msd_to_midi, jobs), 1):
+            found = True
+            if error is None:
+                print(f"{i}: {key} -> {midi_key} ... OK")
+            else:
+                print(f"{i}: {key} ... ERROR: {error}")
+        if not found:
+            print("no msd files found in:", base_path)
+        return
+
     pattern = os.path.join(base_path, "*.msd")
     files = glob.glob(pattern)
 
@@ -166,17 +223,36 @@ def main():
         print("no msd files found in:", base_path)
         return
 
-    for i, file in enumerate(files, 1):
-        try:
-            with open(file, "rb") as f:
-                msd_data = f.read()
-            midi_data = convert_msd_to_midi(msd_data)
-            midi_file = os.path.splitext(file)[0] + ".mid"
-            with open(midi_file, "wb") as f:
-                f.write(midi_data)
-            print(f"{i}: {file} -> {midi_file} ... OK")
-        except Exception as e:
-            print(f"{i}: {file} ... ERROR: {e}")
+    from msdwrite import DurableWriter, DEFAULT_JOBS, DEFAULT_COMMIT_INTERVAL
+    jobs = int(sys.argv[2]) if len(sys.argv) > 2 else DEFAULT_JOBS
+    commit_interval = float(sys.argv[3]) if len(sys.argv) > 3 else DEFAULT_COMMIT_INTERVAL
+
+    results = []
+    with DurableWriter(jobs, commit_interval=commit_interval) as writer:
+        for i, file in enumerate(files, 1):
+            try:
+                with open(file, "rb") as f:
+                    msd_data = f.read()
+                midi_data = convert_msd_to_midi(msd_data)
+                midi_file = os.path.splitext(file)[0] + ".mid"
+                results.append((i, file, midi_file, writer.write(midi_file, midi_data)))
+            except Exception as e:
+                print(f"{i}: {file} ... ERROR: {e}")
+
+            # Report the files committed so far
+            while results and results[0][3].done():
+                report_write(*results.pop(0))
+
+    for result in results:
+        report_write(*result)
+
+def report_write(i, file, midi_file, future):
+    # Print the result of a committed output file.
+    try:
+        future.result()
+        print(f"{i}: {file} -> {midi_file} ... OK")
+    except Exception as e:
+        print(f"{i}: {file} ... ERROR: {e}")
 
 if __name__ == "__main__":
     main()
@@ -0,0 +1,229 @@
+# msdcat.py - Build a searchable catalogue of MSD files
+# Copyright (C) 2025  Ru^3
+#
+# This script decodes every .msd file under a directory with msd2smf, on all
+# CPU cores, and stores per-song metadata in an SQLite database: length and
+# loop points in ticks and microseconds, tempos, used channels and programs,
+# SysEx signatures and a fingerprint of the note sequence. Later scans only
+# decode files whose size and mtime changed and whose contents hash differs,
+# so the catalogue can be refreshed cheaply and queried with plain SQL.
+#
+# The channels column is a bit mask (bit 0 = channel 1), so for example
+#   python msdcat.py music.db query "loop_start_ticks IS NOT NULL AND
+#       length_us > 180e6 AND tempo_count > 1 AND channels & (1 << 9)"
+# lists the looping songs over 3 minutes with tempo changes using channel 10.
+#
+# This file is licensed under the MIT License.
+#
+
+import os
+import sys
+import glob
+import sqlite3
+import hashlib
+from multiprocessing import Pool
+
+from msd2smf import parse_msd, decode_msd_events, split_loop
+
+DEFAULT_TEMPO = 500000
+
+SYSEX_NAMES = {
+    bytes([0xF0, 0x7E, 0x7F, 0x09, 0x01, 0xF7]): "GM",
+    bytes([0xF0, 0x41, 0x10, 0x42, 0x12, 0x40, 0x00, 0x7F, 0x00, 0x41, 0xF7]): "GS",
+    bytes([0xF0, 0x43, 0x10, 0x4C, 0x00, 0x00, 0x7E, 0x00, 0xF7]): "XG",
+}
+
+COLUMNS = [
+    ("path", "TEXT PRIMARY KEY"),
+    ("mtime", "REAL"),
+    ("size", "INTEGER"),
+    ("sha1", "TEXT"),
+    ("timebase", "INTEGER"),
+    ("length_ticks", "INTEGER"),
+    ("length_us", "INTEGER"),
+    ("loop_start_ticks", "INTEGER"),
+    ("loop_start_us", "INTEGER"),
+    ("loop_end_ticks", "INTEGER"),
+    ("loop_end_us", "INTEGER"),
+    ("tempo_count", "INTEGER"),
+    ("tempos", "TEXT"),
+    ("channels", "INTEGER"),
+    ("programs", "TEXT"),
+    ("sysex", "TEXT"),
+    ("fingerprint", "TEXT"),
+    ("error", "TEXT"),
+]
+
+def sysex_signature(data):
+    # Name a SysEx message by its well-known meaning or its header bytes.
+    if data[:1] != b'\xf0':
+        data = b'\xf0' + data
+    if data in SYSEX_NAMES:
+        return SYSEX_NAMES[data]
+    return data[1:4].hex()
+
+def analyze_msd(msd_bytes):
+    # Extract the catalogue metadata of MSD binary data.
+    timebase, packets = parse_msd(msd_bytes)
+    intro, loop = split_loop(packets)
+
+    ticks = 0
+    micros = 0
+    deltatime = 0
+    tempo = DEFAULT_TEMPO
+    tempos = []
+    channels = 0
+    programs = set()
+    sysex = set()
+    notes = hashlib.sha1()
+    loop_start = None
+
+    def advance():
+        # Move the song position to the next emitted event.
+        nonlocal ticks, micros, deltatime
+        ticks += deltatime
+        micros += deltatime * tempo / timebase if timebase else 0
+        deltatime = 0
+
+    for section in (intro, loop):
+        if section is None:
+            continue
+        if section is loop:
+            advance()
+            loop_start = (ticks, int(micros))
+
+        for pkt in section:
+            for _, dtime, kind, _, body in decode_msd_events(pkt["Payload"]):
+                deltatime += dtime
+
+                if kind == 'short':
+                    advance()
+                    status = body[0] if body else 0
+                    if 0x80 <= status < 0xF0:
+                        channels |= 1 << (status & 0x0F)
+                    if status & 0xF0 == 0xC0 and len(body) > 1:
+                        programs.add((status & 0x0F, body[1]))
+                    if status & 0xF0 == 0x90 and len(body) > 2 and body[2]:
+                        notes.update(ticks.to_bytes(8, "little") + body[1:2])
+
+                elif kind == 'tempo':
+                    advance()
+                    tempo = int.from_bytes(body, "big")
+                    tempos.append(tempo)
+
+                elif kind == 'sysex':
+                    if body is not None:
+                        advance()
+                        sysex.add(sysex_signature(body))
+                    deltatime = 0
+
+    advance()
+    return {
+        "timebase": timebase,
+        "length_ticks": ticks,
+        "length_us": int(micros),
+        "loop_start_ticks": loop_start[0] if loop_start else None,
+        "loop_start_us": loop_start[1] if loop_start else None,
+        "loop_end_ticks": ticks if loop_start else None,
+        "loop_end_us": int(micros) if loop_start else None,
+        "tempo_count": len(tempos),
+        "tempos": ",".join(str(t) for t in sorted(set(tempos))),
+        "channels": channels,
+        "programs": ",".join(f"{ch + 1}:{prog}" for ch, prog in sorted(programs)),
+        "sysex": ",".join(sorted(sysex)),
+        "fingerprint": notes.hexdigest(),
+    }
+
+def scan_file(args):
+    # Hash and analyze one file; skip the analysis if the hash is unchanged.
+    path, mtime, size, old_sha1 = args
+    row = {"path": path, "mtime": mtime, "size": size}
+    try:
+        with open(path, "rb") as f:
+            msd_data = f.read()
+    except OSError as e:
+        # Unreadable or gone: not stored as up to date, so the next scan retries
+        row.update(mtime=None, error=str(e))
+        return row, True
+    row["sha1"] = hashlib.sha1(msd_data).hexdigest()
+    if row["sha1"] == old_sha1:
+        return row, False
+    try:
+        row.update(analyze_msd(msd_data))
+    except Exception as e:
+        row["error"] = str(e)
+    return row, True
+
+def open_catalogue(db_path):
+    # Open the catalogue database, creating the table if needed.
+    db = sqlite3.connect(db_path)
+    db.execute("CREATE TABLE IF NOT EXISTS songs (" +
+               ", ".join(f"{name} {kind}" for name, kind in COLUMNS) + ")")
+    for column in ("length_us", "loop_start_ticks", "channels", "fingerprint", "sha1"):
+        db.execute(f"CREATE INDEX IF NOT EXISTS songs_{column} ON songs ({column})")
+    return db
+
+def scan_catalogue(db, base_path, jobs=None):
+    # Bring the catalogue up to date with the .msd files under base_path.
+    base_path = os.path.abspath(base_path)
+    files = glob.glob(os.path.join(base_path, "**", "*.msd"), recursive=True)
+    known = {path: (mtime, size, sha1) for path, mtime, size, sha1 in
+             db.execute("SELECT path, mtime, size, sha1 FROM songs")}
+
+    tasks = []
+    for path in files:
+        try:
+            st = os.stat(path)
+        except OSError:
+            continue
+        old = known.get(path)
+        if old and old[0] == st.st_mtime and old[1] == st.st_size:
+            continue
+        tasks.append((path, st.st_mtime, st.st_size, old[2] if old else None))
+
+    found = set(files)
+    removed = [path for path in known
+               if path.startswith(base_path + os.sep) and path not in found]
+
+    updated = 0
+    with db:
+        db.executemany("DELETE FROM songs WHERE path = ?", [(path,) for path in removed])
+        if tasks:
+            with Pool(jobs) as pool:
+                for row, changed in pool.imap_unordered(scan_file, tasks, chunksize=16):
+                    if changed:
+                        row = {**dict.fromkeys(name for name, _ in COLUMNS), **row}
+                        db.execute(f"INSERT OR REPLACE INTO songs VALUES ({', '.join('?' * len(COLUMNS))})",
+                                   [row[name] for name, _ in COLUMNS])
+                        updated += 1
+                    else:
+                        db.execute("UPDATE songs SET mtime = ?, size = ? WHERE path = ?",
+                                   (row["mtime"], row["size"], row["path"]))
+
+    return len(files), updated, len(removed)
+
+def main():
+    # Entry point for command-line usage
+    if len(sys.argv) < 4 or sys.argv[2] not in ("scan", "query"):
+        print("usage: msdcat [catalogue] scan [path] [jobs]")
+        print("       msdcat [catalogue] query [condition]")
+        return
+
+    db = open_catalogue(sys.argv[1])
+
+    if sys.argv[2] == "scan":
+        jobs = int(sys.argv[4]) if len(sys.argv) > 4 else None
+        total, updated, removed = scan_catalogue(db, sys.argv[3], jobs)
+        print(f"{total} files, {updated} updated, {removed} removed")
+    else:
+        cursor = db.execute(f"SELECT path, length_us, loop_start_us, tempos, programs, sysex "
+                            f"FROM songs WHERE error IS NULL AND ({sys.argv[3]}) ORDER BY path")
+        for path, length_us, loop_us, tempos, programs, sysex in cursor:
+            loop = "-" if loop_us is None else f"{loop_us / 1e6:.2f}s"
+            print(f"{path}: {length_us / 1e6:.2f}s loop {loop} tempo [{tempos}] "
+                  f"program [{programs}] sysex [{sysex}]")
+
+    db.close()
+
+if __name__ == "__main__":
+    main()
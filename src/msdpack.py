@@ -0,0 +1,150 @@
+# msdpack.py - Rewrite MSD files into a compact canonical layout
+# Copyright (C) 2025  Ru^3
+#
+# This script decodes an MSD file with msd2smf and writes it back with dead
+# records removed: skip blocks and no-op events are dropped (their delta times
+# are folded into the following event), all packets before and after the loop
+# target are merged, and packet IDs are renumbered densely. Every repacked file
+# is converted to SMF again and compared with the original conversion, so the
+# output is never written unless it plays back identically.
+#
+# This file is licensed under the MIT License.
+#
+
+import struct
+import os
+import sys
+import glob
+
+from msd2smf import parse_msd, decode_msd_events, split_loop, convert_msd_to_midi
+
+MAX_DELTATIME = 0xFFFFFFFF
+
+def pack_nop(deltatime):
+    # Construct a no-op event that only carries a delta time.
+    return struct.pack("<II", deltatime, 0) + b'\xff\x00\x00\x00'
+
+def pack_event(record, deltatime, body=None):
+    # Re-encode a decoded event with a new delta time.
+    result = b''
+    while deltatime > MAX_DELTATIME:
+        result += pack_nop(MAX_DELTATIME)
+        deltatime -= MAX_DELTATIME
+    result += struct.pack("<I", deltatime) + record[4:12]
+    if body is not None:
+        result += body + bytes(-len(body) & 3)
+    return result
+
+def pack_section(packets):
+    # Merge the events of consecutive packets into a list of encoded records.
+    records = []
+    deltatime = 0
+
+    for pkt in packets:
+        for _, dtime, kind, record, body in decode_msd_events(pkt["Payload"]):
+            deltatime += dtime
+
+            if kind == 'nop' or kind == 'skip':
+                continue
+
+            if kind == 'sysex':
+                if body is None:
+                    raise ValueError("Truncated SysEx event")
+                records.append(pack_event(record, deltatime, body))
+            else:
+                records.append(pack_event(record, deltatime))
+            deltatime = 0
+
+    if deltatime:
+        # Keep the trailing delta time so the loop point does not move
+        records.append(pack_event(pack_nop(0), deltatime))
+
+    return records
+
+def split_records(records, max_packet_size):
+    # Group encoded records into packet payloads of at most max_packet_size bytes.
+    if not max_packet_size:
+        return [b''.join(records)]
+
+    payloads = []
+    current = b''
+    for record in records:
+        if current and len(current) + len(record) > max_packet_size:
+            payloads.append(current)
+            current = b''
+        current += record
+    payloads.append(current)
+    return payloads
+
+def repack_msd(msd_bytes, max_packet_size=0):
+    # Rewrite MSD binary data into the compact layout and verify the result.
+    _, packets = parse_msd(msd_bytes)
+    if not packets:
+        return msd_bytes[:0x14]
+
+    # Split the packet list at the loop target; each part becomes one packet
+    loop_id = packets[-1]["Next ID"]
+    intro, loop = split_loop(packets)
+    sections = [section for section in (intro, loop) if section]
+    loop_section = len(sections) - 1 if loop else None
+
+    out_packets = []
+    loop_pid = None
+    for i, section in enumerate(sections):
+        if i == loop_section:
+            loop_pid = len(out_packets)
+        for payload in split_records(pack_section(section), max_packet_size):
+            out_packets.append((section[0]["Param"], payload))
+
+    count = len(out_packets)
+    if loop_pid is None:
+        # Keep a non-looping song non-looping with the new IDs
+        last_nid = loop_id if loop_id >= count else count
+    else:
+        last_nid = loop_pid
+
+    result = bytearray(msd_bytes[:0x10])
+    result += struct.pack("<I", count)
+    for pid, (param, payload) in enumerate(out_packets):
+        nid = pid + 1 if pid + 1 < count else last_nid
+        result += struct.pack("<IIII", pid, nid, param, len(payload))
+        result += payload + bytes(-len(payload) & 3)
+    result = bytes(result)
+
+    if convert_msd_to_midi(result) != convert_msd_to_midi(msd_bytes):
+        raise ValueError("Repacked data does not match the original")
+
+    return result
+
+def main():
+    # Entry point for command-line usage
+    if len(sys.argv) < 3:
+        print("usage: msdpack [path] [output path] [max packet size]")
+        return
+
+    base_path = sys.argv[1]
+    out_path = sys.argv[2]
+    max_packet_size = int(sys.argv[3]) if len(sys.argv) > 3 else 0
+    pattern = os.path.join(base_path, "*.msd")
+    files = glob.glob(pattern)
+
+    if not files:
+        print("no msd files found in:", base_path)
+        return
+
+    os.makedirs(out_path, exist_ok=True)
+
+    for i, file in enumerate(files, 1):
+        try:
+            with open(file, "rb") as f:
+                msd_data = f.read()
+            packed_data = repack_msd(msd_data, max_packet_size)
+            packed_file = os.path.join(out_path, os.path.basename(file))
+            with open(packed_file, "wb") as f:
+                f.write(packed_data)
+            print(f"{i}: {file} -> {packed_file} ... OK ({len(msd_data)} -> {len(packed_data)} bytes)")
+        except Exception as e:
+            print(f"{i}: {file} ... ERROR: {e}")
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,290 @@
+# msdpattern.py - Convert MSD files to a pattern table for memory-light playback
+# Copyright (C) 2025  Ru^3
+#
+# This script decodes an MSD file with msd2smf and looks for repeated sections
+# in its event list. Fixed-length windows of events are compared by a rolling
+# hash, the longest repeated section is taken as a pattern, and the search is
+# repeated on what is left. The song is then written as a pattern table
+# (patterns + order list + loop position), so a player only needs to keep the
+# unique patterns in memory and can expand the order list on the fly.
+#
+# Pattern table file (.msp), all values little-endian:
+#   0x00  "WMSP"
+#   0x04  timebase
+#   0x08  pattern count
+#   0x0C  order count
+#   0x10  loop order index (0xFFFFFFFF: no loop)
+#   0x14  order list, 16 bits per entry, padded to 4 bytes
+#   then for each pattern:
+#         data length (32 bits), trailing delta time (32 bits),
+#         data padded to 4 bytes
+# Pattern data is a series of SMF track events (delta time + message, tempo
+# Meta event or SysEx event). The trailing delta time is added to the delta
+# time of the first event of the next pattern, or of the loop marker.
+#
+# This file is licensed under the MIT License.
+#
+
+import struct
+import os
+import sys
+import glob
+
+from msd2smf import (parse_msd, decode_msd_events, split_loop, convert_msd_to_midi,
+                     to_smf, to_smf_metaevent, to_smf_sysex, to_smf_shortmes)
+
+MIN_PATTERN_LENGTH = 8
+NO_LOOP = 0xFFFFFFFF
+
+HASH_BASE = 1000003
+HASH_MOD = (1 << 61) - 1
+
+def tokenize_section(packets):
+    # Decode packets into (deltatime, kind, body) tokens without dead records.
+    tokens = []
+    deltatime = 0
+
+    for pkt in packets:
+        for _, dtime, kind, _, body in decode_msd_events(pkt["Payload"]):
+            deltatime += dtime
+
+            if kind == 'nop' or kind == 'skip':
+                continue
+            if kind == 'sysex' and body is None:
+                raise ValueError("Truncated SysEx event")
+
+            tokens.append((deltatime, kind, body))
+            deltatime = 0
+
+    if deltatime:
+        # Time left before the loop marker or the end of track
+        tokens.append((deltatime, 'wait', None))
+
+    return tokens
+
+def window_hashes(symbols, start, end, length):
+    # Yield the rolling hash of every window of the given length in symbols[start:end].
+    if end - start < length:
+        return
+
+    power = pow(HASH_BASE, length - 1, HASH_MOD)
+    value = 0
+    for symbol in symbols[start:start+length]:
+        value = (value * HASH_BASE + symbol + 1) % HASH_MOD
+    yield start, value
+
+    for pos in range(start + 1, end - length + 1):
+        value = (value - (symbols[pos-1] + 1) * power) % HASH_MOD
+        value = (value * HASH_BASE + symbols[pos+length-1] + 1) % HASH_MOD
+        yield pos, value
+
+def find_repeat(symbols, regions, length):
+    # Find the window of the given length with the most non-overlapping occurrences.
+    seen = {}
+    for start, end in regions:
+        for pos, value in window_hashes(symbols, start, end, length):
+            seen.setdefault(value, []).append(pos)
+
+    best = []
+    for positions in seen.values():
+        if len(positions) <= max(len(best), 1):
+            continue
+        first = symbols[positions[0]:positions[0]+length]
+        occurrences = []
+        for pos in positions:
+            if occurrences and pos < occurrences[-1] + length:
+                continue
+            if symbols[pos:pos+length] == first:
+                occurrences.append(pos)
+        if len(occurrences) > max(len(best), 1):
+            best = occurrences
+
+    return best
+
+def cut_regions(regions, occurrences, length):
+    # Remove the claimed occurrences from the list of unclaimed regions.
+    result = []
+    for start, end in regions:
+        for pos in occurrences:
+            if start <= pos < end:
+                if pos > start:
+                    result.append((start, pos))
+                start = pos + length
+        if end > start:
+            result.append((start, end))
+    return result
+
+def find_segments(symbols, regions, min_length):
+    # Split the regions into (position, length) segments, longest repeats first.
+    segments = []
+
+    while True:
+        low = min_length
+        high = max((end - start for start, end in regions), default=0)
+        best = []
+        best_length = 0
+        while low <= high:
+            length = (low + high) // 2
+            occurrences = find_repeat(symbols, regions, length)
+            if occurrences:
+                best, best_length = occurrences, length
+                low = length + 1
+            else:
+                high = length - 1
+
+        if not best:
+            break
+
+        segments += [(pos, best_length) for pos in best]
+        regions = cut_regions(regions, best, best_length)
+
+    # Whatever does not repeat is kept as a pattern of its own
+    segments += [(start, end - start) for start, end in regions]
+    return sorted(segments)
+
+def build_pattern_table(msd_bytes, min_length=MIN_PATTERN_LENGTH):
+    # Build the pattern list, order list and loop order index of an MSD song.
+    # An empty pattern would repeat everywhere, so patterns have at least one event.
+    min_length = max(min_length, 1)
+    timebase, packets = parse_msd(msd_bytes)
+    intro, loop = split_loop(packets)
+
+    tokens = tokenize_section(intro)
+    loop_start = len(tokens)
+    if loop is not None:
+        tokens += tokenize_section(loop)
+
+    symbol_ids = {}
+    symbols = [symbol_ids.setdefault(token, len(symbol_ids)) for token in tokens]
+    regions = [region for region in ((0, loop_start), (loop_start, len(tokens)))
+               if region[1] > region[0]]
+
+    patterns = []
+    pattern_ids = {}
+    order = []
+    loop_order = None
+    for pos, length in find_segments(symbols, regions, min_length):
+        if pos == loop_start and loop is not None:
+            loop_order = len(order)
+        key = tuple(symbols[pos:pos+length])
+        if key not in pattern_ids:
+            pattern_ids[key] = len(patterns)
+            patterns.append(tokens[pos:pos+length])
+        order.append(pattern_ids[key])
+
+    if loop is not None and loop_order is None:
+        # The looped part has no events of its own
+        loop_order = len(order)
+
+    return timebase, patterns, order, loop_order
+
+def expand_pattern_table(timebase, patterns, order, loop_order):
+    # Expand a pattern table back into a MIDI byte stream.
+    track_data = []
+    deltatime = 0
+
+    for i in range(len(order) + 1):
+        if i == loop_order:
+            # Loop start marker (Meta 0x06)
+            track_data.append(to_smf_metaevent(0x06, b'loopStart', deltatime))
+            deltatime = 0
+        if i == len(order):
+            break
+
+        for dtime, kind, body in patterns[order[i]]:
+            deltatime += dtime
+            if kind == 'short':
+                track_data.append(to_smf_shortmes(body, deltatime))
+            elif kind == 'tempo':
+                track_data.append(to_smf_metaevent(0x51, body, deltatime))
+            elif kind == 'sysex':
+                track_data.append(to_smf_sysex(body, deltatime))
+            else:
+                continue
+            deltatime = 0
+
+    if loop_order is not None:
+        # Loop end marker (Meta 0x06)
+        track_data.append(to_smf_metaevent(0x06, b'loopEnd', deltatime))
+        deltatime = 0
+
+    # End of track marker
+    track_data.append(to_smf_metaevent(0x2f, None, deltatime))
+
+    return to_smf([b''.join(track_data)], timebase)
+
+def encode_pattern(tokens):
+    # Encode a pattern as SMF track events and its trailing delta time.
+    events = []
+    tail = 0
+    for dtime, kind, body in tokens:
+        if kind == 'short':
+            events.append(to_smf_shortmes(body, dtime))
+        elif kind == 'tempo':
+            events.append(to_smf_metaevent(0x51, body, dtime))
+        elif kind == 'sysex':
+            events.append(to_smf_sysex(body, dtime))
+        else:
+            tail = dtime
+    return b''.join(events), tail
+
+def to_pattern_table(timebase, patterns, order, loop_order):
+    # Serialize a pattern table into the .msp layout.
+    if len(patterns) > 0xFFFF:
+        raise ValueError("Too many patterns")
+
+    result = bytearray(b"WMSP")
+    result += struct.pack("<IIII", timebase, len(patterns), len(order),
+                          NO_LOOP if loop_order is None else loop_order)
+    result += struct.pack(f"<{len(order)}H", *order)
+    result += bytes(-len(result) & 3)
+
+    for tokens in patterns:
+        data, tail = encode_pattern(tokens)
+        result += struct.pack("<II", len(data), tail)
+        result += data + bytes(-len(data) & 3)
+
+    return bytes(result)
+
+def convert_msd_to_patterns(msd_bytes, min_length=MIN_PATTERN_LENGTH):
+    # Entry point to convert MSD binary data to a pattern table byte stream.
+    table = build_pattern_table(msd_bytes, min_length)
+    if expand_pattern_table(*table) != convert_msd_to_midi(msd_bytes):
+        raise ValueError("Pattern table does not match the original")
+    return to_pattern_table(*table), table
+
+def main():
+    # Entry point for command-line usage
+    if len(sys.argv) < 2:
+        print("usage: msdpattern [path] [min pattern length]")
+        return
+
+    base_path = sys.argv[1]
+    min_length = int(sys.argv[2]) if len(sys.argv) > 2 else MIN_PATTERN_LENGTH
+    if min_length < 1:
+        print("min pattern length must be 1 or more")
+        return
+
+    pattern = os.path.join(base_path, "*.msd")
+    files = glob.glob(pattern)
+
+    if not files:
+        print("no msd files found in:", base_path)
+        return
+
+    for i, file in enumerate(files, 1):
+        try:
+            with open(file, "rb") as f:
+                msd_data = f.read()
+            table_data, (_, patterns, order, _) = convert_msd_to_patterns(msd_data, min_length)
+            table_file = os.path.splitext(file)[0] + ".msp"
+            with open(table_file, "wb") as f:
+                f.write(table_data)
+            expanded = len(convert_msd_to_midi(msd_data))
+            print(f"{i}: {file} -> {table_file} ... OK "
+                  f"({len(patterns)} patterns, {len(order)} orders, {expanded} -> {len(table_data)} bytes)")
+        except Exception as e:
+            print(f"{i}: {file} ... ERROR: {e}")
+
+if __name__ == "__main__":
+    main()
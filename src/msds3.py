@@ -0,0 +1,212 @@
+# msds3.py - S3-compatible object store backend for msd2smf
+# Copyright (C) 2025  Ru^3
+#
+# This module lets msd2smf read .msd files from, and write .mid files to, an
+# S3-compatible object store without syncing them to local disk first. Objects
+# are listed under a prefix, fetched with ranged GETs, converted in memory and
+# uploaded next to their source (with a multipart upload for large outputs).
+# The number of requests in flight never exceeds the given job count.
+#
+# Only the Python standard library is used. The endpoint, region and
+# credentials are taken from the usual environment variables:
+#   AWS_ENDPOINT_URL       e.g. http://127.0.0.1:9000 for a local stand-in
+#   AWS_REGION             (or AWS_DEFAULT_REGION, default us-east-1)
+#   AWS_ACCESS_KEY_ID / AWS_SECRET_ACCESS_KEY / AWS_SESSION_TOKEN
+# Buckets are addressed path-style (endpoint/bucket/key).
+#
+# This file is licensed under the MIT License.
+#
+
+import os
+import time
+import fnmatch
+import posixpath
+import hmac
+import hashlib
+import threading
+import urllib.parse
+import urllib.request
+import urllib.error
+import xml.etree.ElementTree as ET
+from concurrent.futures import ThreadPoolExecutor
+
+RANGE_SIZE = 1 << 20
+MULTIPART_THRESHOLD = 8 << 20
+PART_SIZE = 8 << 20
+DEFAULT_JOBS = 8
+
+def sign(key, msg):
+    # HMAC-SHA256 helper for the signing key derivation.
+    return hmac.new(key, msg.encode("utf-8"), hashlib.sha256).digest()
+
+def quote(value, safe="-_.~"):
+    # URI-encode a value as required by Signature Version 4.
+    return urllib.parse.quote(value, safe=safe)
+
+def strip_ns(tag):
+    # Remove the XML namespace from an element tag.
+    return tag.rsplit("}", 1)[-1]
+
+class S3Client:
+    # Minimal S3 client signing requests with AWS Signature Version 4.
+
+    def __init__(self, endpoint=None, region=None, access_key=None, secret_key=None, token=None,
+                 max_requests=DEFAULT_JOBS):
+        env = os.environ
+        self.region = region or env.get("AWS_REGION") or env.get("AWS_DEFAULT_REGION") or "us-east-1"
+        self.endpoint = (endpoint or env.get("AWS_ENDPOINT_URL")
+                         or f"https://s3.{self.region}.amazonaws.com").rstrip("/")
+        self.access_key = access_key or env.get("AWS_ACCESS_KEY_ID", "")
+        self.secret_key = secret_key or env.get("AWS_SECRET_ACCESS_KEY", "")
+        self.token = token or env.get("AWS_SESSION_TOKEN")
+        self.host = urllib.parse.urlsplit(self.endpoint).netloc
+        self.slots = threading.BoundedSemaphore(max_requests)
+
+    def request(self, method, bucket, key="", query=None, headers=None, body=b""):
+        # Send a signed request and return (status, headers, body).
+        path = "/" + bucket + ("/" + key if key else "")
+        canonical_uri = quote(path, safe="/-_.~")
+        canonical_query = "&".join(f"{quote(k)}={quote(v)}" for k, v in sorted((query or {}).items()))
+
+        now = time.gmtime()
+        amz_date = time.strftime("%Y%m%dT%H%M%SZ", now)
+        datestamp = time.strftime("%Y%m%d", now)
+        payload_hash = hashlib.sha256(body).hexdigest()
+
+        signed = {"host": self.host, "x-amz-content-sha256": payload_hash, "x-amz-date": amz_date}
+        if self.token:
+            signed["x-amz-security-token"] = self.token
+        signed_headers = ";".join(sorted(signed))
+        canonical_headers = "".join(f"{k}:{signed[k]}\n" for k in sorted(signed))
+
+        canonical_request = "\n".join([method, canonical_uri, canonical_query,
+                                       canonical_headers, signed_headers, payload_hash])
+        scope = f"{datestamp}/{self.region}/s3/aws4_request"
+        string_to_sign = "\n".join(["AWS4-HMAC-SHA256", amz_date, scope,
+                                    hashlib.sha256(canonical_request.encode("utf-8")).hexdigest()])
+
+        signing_key = sign(("AWS4" + self.secret_key).encode("utf-8"), datestamp)
+        for part in (self.region, "s3", "aws4_request"):
+            signing_key = sign(signing_key, part)
+        signature = hmac.new(signing_key, string_to_sign.encode("utf-8"), hashlib.sha256).hexdigest()
+
+        all_headers = dict(signed)
+        del all_headers["host"]
+        all_headers.update(headers or {})
+        all_headers["Authorization"] = (f"AWS4-HMAC-SHA256 Credential={self.access_key}/{scope}, "
+                                        f"SignedHeaders={signed_headers}, Signature={signature}")
+
+        url = self.endpoint + canonical_uri + ("?" + canonical_query if canonical_query else "")
+        req = urllib.request.Request(url, data=body if method in ("PUT", "POST") else None,
+                                     headers=all_headers, method=method)
+        with self.slots:
+            try:
+                with urllib.request.urlopen(req) as res:
+                    return res.status, res.headers, res.read()
+            except urllib.error.HTTPError as e:
+                raise IOError(f"{method} {path}: HTTP {e.code} {e.read()[:200]!r}") from None
+
+    def list_objects(self, bucket, prefix="", delimiter=None):
+        # List (key, size) of every object under the prefix.
+        # With a delimiter, keys in deeper "directories" are left out.
+        objects = []
+        query = {"list-type": "2", "prefix": prefix}
+        if delimiter:
+            query["delimiter"] = delimiter
+        while True:
+            _, _, body = self.request("GET", bucket, query=query)
+            root = ET.fromstring(body)
+            token = None
+            truncated = False
+            for elem in root:
+                tag = strip_ns(elem.tag)
+                if tag == "Contents":
+                    fields = {strip_ns(child.tag): child.text for child in elem}
+                    objects.append((fields["Key"], int(fields["Size"])))
+                elif tag == "IsTruncated":
+                    truncated = elem.text == "true"
+                elif tag == "NextContinuationToken":
+                    token = elem.text
+            if not truncated or not token:
+                return objects
+            query = dict(query, **{"continuation-token": token})
+
+    def get_range(self, bucket, key, start, end):
+        # Fetch bytes start..end (inclusive) of an object.
+        _, _, body = self.request("GET", bucket, key, headers={"Range": f"bytes={start}-{end}"})
+        if len(body) != end - start + 1:
+            raise IOError(f"GET {bucket}/{key}: short read at {start}")
+        return body
+
+    def get_object(self, bucket, key, size, pool):
+        # Fetch a whole object with parallel ranged GETs.
+        if size <= RANGE_SIZE:
+            return self.request("GET", bucket, key)[2]
+        ranges = [(start, min(start + RANGE_SIZE, size) - 1) for start in range(0, size, RANGE_SIZE)]
+        parts = [pool.submit(self.get_range, bucket, key, start, end) for start, end in ranges]
+        return b"".join(part.result() for part in parts)
+
+    def put_object(self, bucket, key, data, pool):
+        # Store an object, using a parallel multipart upload for large data.
+        if len(data) <= MULTIPART_THRESHOLD:
+            self.request("PUT", bucket, key, body=data)
+            return
+
+        _, _, body = self.request("POST", bucket, key, query={"uploads": ""})
+        upload_id = next(elem.text for elem in ET.fromstring(body) if strip_ns(elem.tag) == "UploadId")
+        try:
+            def put_part(number, start):
+                query = {"partNumber": str(number), "uploadId": upload_id}
+                _, headers, _ = self.request("PUT", bucket, key, query=query,
+                                             body=data[start:start+PART_SIZE])
+                return headers["ETag"]
+
+            parts = [pool.submit(put_part, number, start)
+                     for number, start in enumerate(range(0, len(data), PART_SIZE), 1)]
+            etags = [part.result() for part in parts]
+
+            complete = "".join(f"<Part><PartNumber>{number}</PartNumber><ETag>{etag}</ETag></Part>"
+                               for number, etag in enumerate(etags, 1))
+            complete = f"<CompleteMultipartUpload>{complete}</CompleteMultipartUpload>".encode("utf-8")
+            self.request("POST", bucket, key, query={"uploadId": upload_id}, body=complete)
+        except Exception:
+            self.request("DELETE", bucket, key, query={"uploadId": upload_id})
+            raise
+
+def split_s3_url(url):
+    # Split an s3://bucket/prefix URL into bucket and directory prefix.
+    parts = urllib.parse.urlsplit(url)
+    prefix = parts.path.lstrip("/")
+    if prefix and not prefix.endswith("/"):
+        prefix += "/"
+    return parts.netloc, prefix
+
+def is_msd_key(key):
+    # Match a key like glob("*.msd") does in a local directory.
+    name = posixpath.basename(key)
+    return not name.startswith(".") and fnmatch.fnmatch(name, "*.msd")
+
+def convert_s3(url, convert, jobs=DEFAULT_JOBS, client=None):
+    # Convert every .msd object directly under an s3:// URL and yield (key, result key, error).
+    client = client or S3Client(max_requests=jobs)
+    bucket, prefix = split_s3_url(url)
+    objects = [(key, size) for key, size in client.list_objects(bucket, prefix, delimiter="/")
+               if is_msd_key(key)]
+
+    # Transfers run on their own pool so a file waiting for its ranges never
+    # blocks the requests it is waiting for.
+    with ThreadPoolExecutor(max_workers=jobs) as transfers, \
+         ThreadPoolExecutor(max_workers=jobs) as files:
+
+        def convert_object(key, size):
+            midi_key = posixpath.splitext(key)[0] + ".mid"
+            midi_data = convert(client.get_object(bucket, key, size, transfers))
+            client.put_object(bucket, midi_key, midi_data, transfers)
+            return midi_key
+
+        tasks = [(key, files.submit(convert_object, key, size)) for key, size in objects]
+        for key, task in tasks:
+            try:
+                yield key, task.result(), None
+            except Exception as e:
+                yield key, None, e
@@ -0,0 +1,202 @@
+# msdwrite.py - Crash-safe output writer for batch conversion
+# Copyright (C) 2025  Ru^3
+#
+# Files are written in parallel to temp files next to their destination and
+# committed in groups: the data of the whole group is made durable (grouped
+# fdatasync, or one syncfs per file system), the temp files are renamed over
+# their destinations, and each destination directory is fsynced once. After a
+# crash every output is either complete or absent, without paying an fsync per
+# file. A group is committed once it has batch_size files or its oldest file
+# has waited commit_interval seconds, and when the writer is closed.
+#
+# This file is licensed under the MIT License.
+#
+
+import os
+import time
+import ctypes
+import itertools
+import threading
+from concurrent.futures import Future, ThreadPoolExecutor
+
+DEFAULT_JOBS = 8
+DEFAULT_BATCH_SIZE = 64
+DEFAULT_COMMIT_INTERVAL = 1.0
+
+fdatasync = getattr(os, "fdatasync", os.fsync)
+
+def load_syncfs():
+    # Get syncfs(2) from the C library, or None where it is not available.
+    try:
+        return ctypes.CDLL(None, use_errno=True).syncfs
+    except (OSError, AttributeError, TypeError):
+        return None
+
+class DurableWriter:
+    # Write files through temp files and commit them in groups.
+
+    def __init__(self, jobs=DEFAULT_JOBS, batch_size=DEFAULT_BATCH_SIZE,
+                 commit_interval=DEFAULT_COMMIT_INTERVAL, use_syncfs=False):
+        self.batch_size = batch_size
+        self.commit_interval = commit_interval
+        self.syncfs = load_syncfs() if use_syncfs else None
+        self.writers = ThreadPoolExecutor(max_workers=jobs)
+        self.syncers = ThreadPoolExecutor(max_workers=jobs)
+        self.lock = threading.Lock()
+        self.wakeup = threading.Condition(self.lock)
+        self.pending = []
+        self.oldest = None
+        self.closed = False
+        self.counter = itertools.count()
+        self.flusher = threading.Thread(target=self.flush_loop, daemon=True)
+        self.flusher.start()
+
+    def write(self, path, data):
+        # Queue a file write; the future completes once the file is committed.
+        future = Future()
+        self.writers.submit(self.write_temp, path, data, future)
+        return future
+
+    def write_temp(self, path, data, future):
+        # Write the data to a temp file in the destination directory.
+        directory, name = os.path.split(os.path.abspath(path))
+        temp = os.path.join(directory, f".{name}.{os.getpid()}.{next(self.counter)}.tmp")
+        try:
+            fd = os.open(temp, os.O_WRONLY | os.O_CREAT | os.O_TRUNC | getattr(os, "O_BINARY", 0), 0o666)
+            try:
+                view = memoryview(data)
+                while view:
+                    view = view[os.write(fd, view):]
+            except BaseException:
+                os.close(fd)
+                os.unlink(temp)
+                raise
+        except Exception as e:
+            future.set_exception(e)
+            return
+
+        with self.lock:
+            self.pending.append((fd, temp, path, future))
+            if self.oldest is None:
+                self.oldest = time.monotonic()
+                self.wakeup.notify()
+            batch = self.take_pending() if len(self.pending) >= self.batch_size else []
+
+        self.commit(batch)
+
+    def flush_loop(self):
+        # Commit each group once its oldest file has waited commit_interval seconds.
+        while True:
+            with self.lock:
+                while not self.closed:
+                    if self.oldest is None:
+                        self.wakeup.wait()
+                        continue
+                    wait = self.oldest + self.commit_interval - time.monotonic()
+                    if wait <= 0:
+                        break
+                    self.wakeup.wait(wait)
+                if self.closed:
+                    return
+                batch = self.take_pending()
+            self.commit(batch)
+
+    def take_pending(self):
+        # Take the pending group (called with the lock held).
+        batch = self.pending
+        self.pending = []
+        self.oldest = None
+        return batch
+
+    def sync_data(self, batch):
+        # Make the data of every file in the group durable.
+        # Return the error of each file, or None where its data is durable.
+        if self.syncfs:
+            devices = {}
+            for fd, _, _, _ in batch:
+                devices.setdefault(os.fstat(fd).st_dev, []).append(fd)
+            errors = {}
+            for fds in devices.values():
+                error = None
+                if self.syncfs(fds[0]) != 0:
+                    error = OSError(ctypes.get_errno(), "syncfs failed")
+                errors.update(dict.fromkeys(fds, error))
+            return [errors[fd] for fd, _, _, _ in batch]
+
+        def sync(fd):
+            try:
+                fdatasync(fd)
+            except OSError as e:
+                return e
+            return None
+        return list(self.syncers.map(sync, [fd for fd, _, _, _ in batch]))
+
+    def fsync_directory(self, directory):
+        # Make the renames in a directory durable.
+        if os.name == "nt":
+            return
+        fd = os.open(directory, os.O_RDONLY)
+        try:
+            os.fsync(fd)
+        finally:
+            os.close(fd)
+
+    def commit(self, batch):
+        # Sync, rename and fsync the directories of a group of temp files.
+        # Each file gets its own result, so one failure does not fail the group.
+        if not batch:
+            return
+
+        try:
+            errors = self.sync_data(batch)
+        except Exception as e:
+            errors = [e] * len(batch)
+        for fd, _, _, _ in batch:
+            os.close(fd)
+
+        renamed = {}
+        for i, (_, temp, path, _) in enumerate(batch):
+            if errors[i] is None:
+                try:
+                    os.replace(temp, path)
+                    renamed.setdefault(os.path.dirname(os.path.abspath(path)), []).append(i)
+                    continue
+                except Exception as e:
+                    errors[i] = e
+            if os.path.exists(temp):
+                os.unlink(temp)
+
+        for directory, files in renamed.items():
+            try:
+                self.fsync_directory(directory)
+            except Exception as e:
+                for i in files:
+                    errors[i] = e
+
+        for (_, _, _, future), error in zip(batch, errors):
+            if error is None:
+                future.set_result(None)
+            else:
+                future.set_exception(error)
+
+    def flush(self):
+        # Commit the files written so far.
+        with self.lock:
+            batch = self.take_pending()
+        self.commit(batch)
+
+    def close(self):
+        # Wait for the queued writes and commit everything.
+        self.writers.shutdown(wait=True)
+        with self.lock:
+            self.closed = True
+            self.wakeup.notify()
+        self.flusher.join()
+        self.flush()
+        self.syncers.shutdown(wait=True)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()